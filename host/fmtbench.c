@@ -0,0 +1,440 @@
+/*
+ * uFormat host benchmark
+ *
+ * Runs format_floppy() (or format_floppies() for several drives),
+ * verify_floppy() and init_floppy() (or write_image()/read_image()) from
+ * FORMAT.C against the emulated drives in scsiemu.c and reports, per full format, the number
+ * of commands issued, the bytes transferred and the modeled wall time.
+ * With -P it measures the idle polling of the main dialog instead, with
+ * -B it checks how UBATCH.TTP waits for the next disk.
+ *
+ * Distributed under the MIT license, see LICENSE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tosemu.h"
+#include "scsiemu.h"
+
+#include "../FORMAT.C"
+
+#define MAXBAD	32
+#define MAXDRIVES	EMU_MAXUNITS
+
+static int verbose;
+static long bad[MAXBAD];
+static int nbadlist;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: fmtbench [options]\n"
+		"  -d          format a 720K disk (default 1.44MB)\n"
+		"  -n runs     number of full formats (default 1)\n"
+		"  -D drives   format several drives on two buses together (max %d)\n"
+		"  -l label    volume label (default FLOPPY  USB)\n"
+		"  -W          whole disk FORMAT UNIT instead of track by track\n"
+		"  -q          quick format of an already formatted disk\n"
+		"  -V          verify after formatting\n"
+		"  -y retries  format a failing track side again up to retries times\n"
+		"  -b lba,...  unreadable sectors on the medium\n"
+		"  -m bytes    MaxLen of the bus (default %lu)\n"
+		"  -o us       command overhead (default %lu)\n"
+		"  -x ns       transfer time per byte (default %lu)\n"
+		"  -r us       time per revolution (default %lu)\n"
+		"  -t us       time per cylinder stepped (default %lu)\n"
+		"  -f us       time to format a track side (default %lu)\n"
+		"  -i us       index latency of a single track format (default %lu)\n"
+		"  -L us       rotational latency of a READ(10)/WRITE(10) (default %lu)\n"
+		"  -e op:nth:count:key:asc:ascq\n"
+		"              fail occurrences nth..nth+count-1 of opcode with\n"
+		"              the given sense data (hex, nth 0 = every one)\n"
+		"  -I file     write a raw disk image instead of init_floppy()\n"
+		"  -R file     read the disk back into a raw image\n"
+		"  -w file     save the resulting disk image\n"
+		"  -T file     save the command trace at the end\n"
+		"  -P seconds  idle drive polling with a disk change halfway\n"
+		"  -B polls    batch: polls with the formatted disk left in, then a swap\n"
+		"  -v          show progress\n",
+		MAXDRIVES, (unsigned long)emu_maxlen, emu_time.overhead, emu_time.xfer, emu_time.rev, emu_time.step, emu_time.track, emu_time.index, emu_time.latency);
+	exit(2);
+}
+
+static void updatebar(int track)
+{
+	if (verbose)
+		fprintf(stderr, "\rtrack %2d", track);
+}
+
+static void updatebars(int drive, int track)
+{
+	if (verbose)
+		fprintf(stderr, "\rdrive %d track %2d", drive, track);
+}
+
+static int fault_option(char *arg)
+{
+	unsigned int op, key, asc, ascq;
+	unsigned long nth, count;
+
+	if (sscanf(arg, "%x:%lu:%lu:%x:%x:%x", &op, &nth, &count, &key, &asc, &ascq) != 6)
+		return -1;
+	return emu_fault(0, op, nth, count, key, asc, ascq);
+}
+
+static int bad_option(char *arg)
+{
+	char *p;
+
+	for (p = strtok(arg, ","); p; p = strtok(NULL, ",")) {
+		if (nbadlist == MAXBAD)
+			return -1;
+		bad[nbadlist++] = strtol(p, NULL, 0);
+	}
+	return 0;
+}
+
+static int fat_entry(unsigned char *fat, int cluster)
+{
+	unsigned char *p = fat + cluster + cluster / 2;
+
+	return (cluster & 1) ? (p[0] >> 4) | (p[1] << 4) : p[0] | ((p[1] & 0x0F) << 8);
+}
+
+/* compare the emulated medium with a raw image file */
+static int compare_image(int unit, char *name)
+{
+	unsigned char *img = emu_image(unit);
+	unsigned char buf[BYTES_PER_SECTOR];
+	FILE *f;
+	long n;
+	int ok = 1;
+
+	if ((f = fopen(name, "rb")) == NULL)
+		return 0;
+	for (n = 0; n < emu_blocks(unit) && ok; n++)
+		ok = fread(buf, BYTES_PER_SECTOR, 1, f) == 1 && memcmp(buf, img + n * BYTES_PER_SECTOR, BYTES_PER_SECTOR) == 0;
+	if (ok && fread(buf, 1, 1, f) != 0)
+		ok = 0;
+	fclose(f);
+	return ok;
+}
+
+/* check boot sector, both FATs, bad clusters and volume label written by init_floppy() */
+static int check_image(int unit, int disktype, char *label, int verify)
+{
+	unsigned char *img = emu_image(unit);
+	unsigned char *p;
+	long nsects;
+	int spf, spc, datastart, i, j;
+
+	if (img == NULL || emu_blocks(unit) == 0)
+		return 0;
+	nsects = img[19] | (img[20] << 8);
+	spf = img[22] | (img[23] << 8);
+	spc = img[13];
+	datastart = 1 + 2 * spf + (disktype == 4 ? 14 : 7);
+	if (img[0] != 0xe9 || nsects != emu_blocks(unit) || nsects != (disktype == 4 ? EMU_HD : EMU_DD))
+		return 0;
+	for (i = 0; i < 2; i++) {
+		p = img + (1L + i * spf) * BYTES_PER_SECTOR;
+		if (p[0] != 0xf9 || p[1] != 0xff || p[2] != 0xff)
+			return 0;
+		for (j = 0; verify && j < nbadlist; j++)
+			if (bad[j] >= datastart && bad[j] < nsects && fat_entry(p, 2 + (bad[j] - datastart) / spc) != 0xFF7)
+				return 0;
+	}
+	p = img + (1L + 2 * spf) * BYTES_PER_SECTOR;
+	if (memcmp(p, label, strlen(label)) != 0 || p[11] != FA_VOL)
+		return 0;
+	return 1;
+}
+
+/* poll_drive() on an idle drive, against the former bus rescan every 2 s */
+static int poll_bench(long seconds)
+{
+	tBusInfo bus;
+	drivecache cache;
+	driveinfo info;
+	DLONG id;
+	tHandle h;
+	long ms, swap, seen = -1L, polls;
+	int rc, swapped = 0;
+
+	emu_insert(0, EMU_HD, 1, 0);
+	if (!find_usb_bus(&bus)) {
+		fprintf(stderr, "fmtbench: no USB bus\n");
+		return 1;
+	}
+	printf("uformat polling benchmark: %ld s idle, disk changed at %ld s\n\n", seconds, seconds / 2);
+
+	memset(&cache, 0, sizeof(cache));
+	swap = seconds * 500L;
+	emu_reset_stats();
+	for (ms = 0, polls = 0; ms < seconds * 1000L; ms += cache.wait, polls++) {
+		if (swapped == 0 && ms >= swap) {
+			emu_insert(0, EMU_DD, 0, 0);	/* changed at swap, seen by this poll */
+			swapped = 1;
+		}
+		rc = poll_drive(&cache, &bus);
+		if (rc == DRV_MEDIA && swapped && seen < 0)
+			seen = ms - swap;
+	}
+	printf("cached handle: %ld polls, %lu commands, %.3f s in commands, change seen after %.1f s (at most %d s)\n",
+		polls, emu_stat.commands, emu_stat.time / 1e6, seen / 1e3, POLL_MAX / 1000);
+	close_handle(cache.handle);
+
+	emu_reset_stats();
+	for (ms = 0, polls = 0; ms < seconds * 1000L; ms += 2000, polls++) {
+		h = find_drive(&bus, &info, &id);
+		if (h)
+			close_handle(h);
+	}
+	printf("bus rescan:    %ld polls, %lu commands, %.3f s in commands\n",
+		polls, emu_stat.commands, emu_stat.time / 1e6);
+	return (seen < 0) ? 1 : 0;
+}
+
+/* UBATCH.TTP waiting for its next disk: the formatted one must not be taken again */
+static int batch_bench(long polls)
+{
+	tBusInfo bus;
+	drivecache cache;
+	diskinfo disk;
+	long i, at[4];
+	int out = 1, n = 0;
+	long rc = 0L;
+
+	emu_insert(0, EMU_HD, 0, 0);
+	if (!find_usb_bus(&bus)) {
+		fprintf(stderr, "fmtbench: no USB bus\n");
+		return 1;
+	}
+	printf("uformat batch check: %ld polls with the disk left in, then a swap seen empty,\n"
+		"%ld polls with the disk left in, then a swap within one poll\n\n", polls, polls);
+
+	memset(&cache, 0, sizeof(cache));
+	for (i = 0; i < 3 * polls + 3 && n < 4 && rc == 0L; i++) {
+		if (i == polls)
+			emu_eject(0);
+		else if (i == polls + 1 || i == 2 * polls + 2)
+			emu_insert(0, EMU_HD, 0, 0);	/* unit attention 28/00 */
+		if (!new_disk(&cache, &bus, &out)) {
+			emu_advance(500000L);			/* BATCH_POLL */
+			continue;
+		}
+		at[n++] = i;
+		/* as batch_format() in UBATCH.C */
+		rc = get_capacities(cache.handle, &disk);
+		if (rc == 0L)
+			rc = format_floppy(cache.handle, disk.capdescHD, 0, updatebar);
+		if (rc == 0L)
+			rc = init_floppy(cache.handle, 4, "BATCH", NULL);
+		media_changed(cache.handle);
+		out = 0;
+	}
+	for (i = 0; i < n; i++)
+		printf("disk %ld formatted at poll %ld\n", i + 1, at[i]);
+	close_handle(cache.handle);
+	if (rc != 0L || n != 3 || at[0] >= polls || at[1] <= polls || at[1] >= 2 * polls + 2 || at[2] < 2 * polls + 2) {
+		printf("result: FAILED (rc %ld)\n", rc);
+		return 1;
+	}
+	printf("result: each disk formatted once, only after a swap\n");
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	tHandle handles[MAXDRIVES];
+	driveinfo drive[MAXDRIVES];
+	diskinfo disk[MAXDRIVES];
+	fmtjob jobs[MAXDRIVES];
+	emu_stats total;
+	unsigned long long start, wall = 0;
+	char *label = "FLOPPY  USB";
+	char *image = NULL, *inimage = NULL, *outimage = NULL, *tracefile = NULL;
+	FILE *f = NULL;
+	char *capdesc[MAXDRIVES];
+	int disktype = 4, runs = 1, drives = 1, whole = 0, quick = 0, verify = 0, retries = 0, failed = 0;
+	char badmap[MAX_SECTORS / 8];
+	int nbad = 0;
+	int i, c, d;
+	long rc, drc, poll = 0, batch = 0;
+
+	while ((c = getopt(argc, argv, "hdn:D:l:WqVy:b:m:o:x:r:t:f:i:L:e:I:R:w:T:P:B:v")) != -1) {
+		switch (c) {
+			case 'h' : usage(); break;
+			case 'd' : disktype = 3; break;
+			case 'n' : runs = atoi(optarg); break;
+			case 'D' : drives = atoi(optarg); break;
+			case 'l' : label = optarg; break;
+			case 'W' : whole = 1; break;
+			case 'q' : quick = 1; break;
+			case 'V' : verify = 1; break;
+			case 'y' : retries = atoi(optarg); break;
+			case 'b' :
+				if (bad_option(optarg) != 0)
+					usage();
+				break;
+			case 'm' : emu_maxlen = strtoul(optarg, NULL, 0); break;
+			case 'o' : emu_time.overhead = strtoul(optarg, NULL, 0); break;
+			case 'x' : emu_time.xfer = strtoul(optarg, NULL, 0); break;
+			case 'r' : emu_time.rev = strtoul(optarg, NULL, 0); break;
+			case 't' : emu_time.step = strtoul(optarg, NULL, 0); break;
+			case 'f' : emu_time.track = strtoul(optarg, NULL, 0); break;
+			case 'i' : emu_time.index = strtoul(optarg, NULL, 0); break;
+			case 'L' : emu_time.latency = strtoul(optarg, NULL, 0); break;
+			case 'e' :
+				if (fault_option(optarg) != 0)
+					usage();
+				break;
+			case 'I' : inimage = optarg; break;
+			case 'R' : outimage = optarg; break;
+			case 'w' : image = optarg; break;
+			case 'T' : tracefile = optarg; break;
+			case 'P' : poll = atol(optarg); break;
+			case 'B' : batch = atol(optarg); break;
+			case 'v' : verbose = 1; break;
+			default : usage();
+		}
+	}
+	if (runs < 1 || strlen(label) > 11 || (inimage && verify) || drives < 1 || drives > MAXDRIVES ||
+		(drives > 1 && (inimage || outimage)))
+		usage();
+	if (drives > 1)
+		emu_busses = 2;
+	if (inimage) {
+		if ((f = fopen(inimage, "rb")) == NULL || (disktype = image_disktype(f)) == 0) {
+			fprintf(stderr, "fmtbench: %s is not a 720K or 1.44MB image\n", inimage);
+			return 1;
+		}
+	}
+
+	emu_init();
+	if (!init_scsi()) {
+		fprintf(stderr, "fmtbench: no SCSIDRV\n");
+		return 1;
+	}
+	if (poll > 0)
+		return poll_bench(poll);
+	if (batch > 0)
+		return batch_bench(batch);
+
+	printf("uformat benchmark: %s, %s%s%s%s, %d drive(s), %d run(s)\n", (disktype == 4) ? "1.44MB" : "720K",
+		quick ? "quick" : whole ? "whole disk" : "track by track", verify ? ", verify" : "",
+		inimage ? ", write image" : "", outimage ? ", read image" : "", drives, runs);
+	printf("timing: overhead %luus, xfer %luns/byte, rev %luus, step %luus, track %luus, index %luus, latency %luus\n\n",
+		emu_time.overhead, emu_time.xfer, emu_time.rev, emu_time.step, emu_time.track, emu_time.index, emu_time.latency);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < runs; i++) {
+		for (d = 0; d < drives; d++) {
+			emu_insert(d, (disktype == 4) ? EMU_HD : EMU_DD, quick, 0);
+			for (c = 0; c < nbadlist; c++)
+				emu_bad(d, bad[c]);
+		}
+		if (find_drives(handles, drive, MAXDRIVES, NULL) != drives) {
+			fprintf(stderr, "fmtbench: drive not found\n");
+			return 1;
+		}
+		for (d = 0; d < drives; d++) {
+			get_capacities(handles[d], &disk[d]);
+			get_write_protect(handles[d], &disk[d]);
+			capdesc[d] = (disktype == 4) ? disk[d].capdescHD : disk[d].capdescDD;
+		}
+
+		emu_reset_stats();
+		start = emu_clock();
+		if (drives > 1) {
+			for (d = 0; d < drives; d++) {
+				start_format(&jobs[d], handles[d], capdesc[d], whole, 1);
+				jobs[d].retries = retries;
+				if (quick && media_formatted(&disk[d], capdesc[d]))
+					end_job(&jobs[d], 0L);
+			}
+			format_floppies(jobs, drives, updatebars);
+		}else if (quick && media_formatted(&disk[0], capdesc[0]))
+			jobs[0].rc = 0L;
+		else if (retries) {
+			/* as format_floppy(), with the retries set */
+			start_format(&jobs[0], handles[0], capdesc[0], whole, 0);
+			jobs[0].retries = retries;
+			format_floppies(jobs, 1, updatebars);
+		}else
+			jobs[0].rc = format_floppy(handles[0], capdesc[0], whole, updatebar);
+
+		rc = 0L;
+		for (d = 0; d < drives; d++) {
+			drc = jobs[d].rc;
+			if (drc == 0L && verify)
+				drc = verify_floppy(handles[d], disktype, drive[d].maxlen, badmap, &nbad, updatebar);
+			if (drc == 0L && inimage)
+				drc = write_image(handles[d], f, disktype, drive[d].maxlen, !(quick && media_formatted(&disk[d], capdesc[d])), updatebar);
+			else if (drc == 0L)
+				drc = init_floppy(handles[d], disktype, label, verify ? badmap : NULL);
+			if (drc == 0L && outimage) {
+				FILE *out = fopen(outimage, "wb");
+
+				drc = out ? read_image(handles[d], out, disktype, drive[d].maxlen, updatebar) : IMAGE_ERROR;
+				if (out && fclose(out) != 0 && drc == 0L)
+					drc = IMAGE_ERROR;
+			}
+			c = emu_unit(handles[d]);
+			if (drc != 0L || (inimage ? !compare_image(c, inimage) : !check_image(c, disktype, label, verify)) ||
+				(outimage && !compare_image(c, outimage)))
+				failed++;
+			if (rc == 0L)
+				rc = drc;
+		}
+		start = emu_clock() - start;
+		if (verbose)
+			fprintf(stderr, "\n");
+
+		printf("run %d: rc %ld, %lu commands, %lu bytes, %.3f s modeled", i + 1, rc,
+			emu_stat.commands, emu_stat.bytes, start / 1e6);
+		if (verify)
+			printf(", %d bad sectors", nbad);
+		if (retries)
+			for (d = 0; d < drives; d++)
+				printf(", drive %d %d retries", d, jobs[d].retried);
+		printf("\n");
+
+		total.commands += emu_stat.commands;
+		total.bytes += emu_stat.bytes;
+		total.time += emu_stat.time;
+		wall += start;
+		for (c = 0; c < 256; c++) {
+			total.count[c] += emu_stat.count[c];
+			total.optime[c] += emu_stat.optime[c];
+		}
+		for (d = 0; d < drives; d++)
+			close_handle(handles[d]);
+	}
+
+	printf("\nper format: %.1f commands, %.0f bytes, %.3f s modeled (%.3f s in commands)\n\n",
+		(double)total.commands / runs, (double)total.bytes / runs, wall / 1e6 / runs, total.time / 1e6 / runs);
+	printf("%-24s %8s %12s %10s\n", "command", "count", "total ms", "avg ms");
+	for (c = 0; c < 256; c++) {
+		if (total.count[c] == 0)
+			continue;
+		printf("%-24s %8.1f %12.1f %10.2f\n", emu_opname(c), (double)total.count[c] / runs,
+			total.optime[c] / 1e3 / runs, total.optime[c] / 1e3 / total.count[c]);
+	}
+	printf("\nresult: %s\n", failed ? "FAILED" : "disk image OK");
+
+	if (f)
+		fclose(f);
+
+	if (tracefile && save_trace(tracefile) != 0L) {
+		fprintf(stderr, "fmtbench: cannot write %s\n", tracefile);
+		return 1;
+	}
+	if (image && emu_save(0, image) != 0) {
+		fprintf(stderr, "fmtbench: cannot write %s\n", image);
+		return 1;
+	}
+	return failed ? 1 : 0;
+}
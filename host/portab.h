@@ -0,0 +1,24 @@
+/*
+ * portab.h for the host build
+ *
+ * Pure C's portable types, so that SCSIDEFS.H and FORMAT.C compile
+ * unchanged with gcc. Build with -funsigned-char to match Pure C -K.
+ */
+
+#ifndef __PORTAB__
+#define __PORTAB__
+
+typedef char			BYTE;
+typedef unsigned char	UBYTE;
+typedef short			WORD;
+typedef unsigned short	UWORD;
+typedef long			LONG;		/* must hold a tHandle pointer */
+typedef unsigned long	ULONG;
+typedef int				BOOLEAN;
+
+#define TRUE	1
+#define FALSE	0
+
+#define cdecl
+
+#endif
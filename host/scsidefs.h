@@ -0,0 +1,6 @@
+/*
+ * FORMAT.C includes "scsidefs.h"; on a case sensitive file system
+ * forward it to the real header in the parent directory.
+ */
+
+#include "../SCSIDEFS.H"
@@ -0,0 +1,667 @@
+/*
+ * uFormat host SCSIDRV emulator
+ *
+ * Implements the initiator half of the SCSIDRV call table for up to
+ * EMU_MAXUNITS UFI floppy drives on one "USB Mass Storage" bus, or spread
+ * over emu_busses of them.
+ * Commands complete at once; what they would have cost on a real
+ * drive is added to a modeled clock (see emu_timing), which is what
+ * the benchmark reports.
+ *
+ * Supported commands: TEST UNIT READY, REQUEST SENSE, INQUIRY,
+ * READ FORMAT CAPACITIES, FORMAT UNIT, READ(10), WRITE(10),
+ * MODE SENSE(10). Sectors can be marked bad, READ(10) fails on them
+ * after the drive's retries.
+ *
+ * Every READ(10)/WRITE(10) pays emu_time.latency of rotational latency,
+ * a single track format waits emu_time.index for the index hole. With
+ * Immed set the format runs in the background and reports its progress
+ * through REQUEST SENSE, so several drives can format at the same time.
+ *
+ * Distributed under the MIT license, see LICENSE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scsidefs.h"
+#include "scsiemu.h"
+#include "tosemu.h"
+
+#define SECTOR			512
+#define CYLINDERS		80
+#define EMU_BUSNO		2
+
+/* sense keys */
+#define NO_SENSE		0x00
+#define NOT_READY		0x02
+#define MEDIUM_ERROR	0x03
+#define ILLEGAL_REQUEST	0x05
+#define UNIT_ATTENTION	0x06
+#define DATA_PROTECT	0x07
+
+#define CHECK_CONDITION	2L
+
+typedef struct {
+	unsigned char opcode;
+	unsigned long nth;		/* first failing occurrence, 0 = every one */
+	unsigned long count;	/* number of failing occurrences */
+	unsigned char key, asc, ascq;
+}fault;
+
+typedef struct {
+	WORD features;			/* a tHandle points to the bus features */
+	int present;
+	long media;				/* blocks of the inserted medium, 0 = none */
+	long blocks;			/* blocks of the current format */
+	int spt;				/* sectors per track of the current format */
+	char fmt[CYLINDERS * 2];	/* track side formatted with current format */
+	int wp;
+	int errs;				/* pending cErrMediach / cErrReset bits */
+	int head;				/* cylinder under the head */
+	int attention;			/* medium inserted, unit attention 28/00 pending */
+	unsigned long long busy_from, busy_until;	/* background format */
+	unsigned char *image;
+	unsigned char bad[EMU_HD / 8];	/* unreadable sectors */
+	fault faults[EMU_MAXFAULTS];
+	int nfaults;
+	unsigned long seen[256];	/* per opcode occurrences */
+}unit;
+
+emu_timing emu_time = {
+	3000L,		/* 3 ms per command on a full speed USB adapter */
+	1000L,		/* about 1 MB/s */
+	200000L,	/* 300 rpm */
+	3000L,		/* 3 ms track to track */
+	400000L,	/* two revolutions plus settling per track side */
+	0L,			/* not measured on a drive yet, half a revolution at most */
+	0L			/* idem */
+};
+emu_stats emu_stat;
+ULONG emu_maxlen = 65536L;
+int emu_busses = 1;
+
+static unit units[EMU_MAXUNITS];
+static unsigned long long clock_us;
+static tScsiCall table;
+static int inqbus, inqdev;
+
+#define UNIT_BUS(n)		(EMU_BUSNO + (n) % emu_busses)
+
+/*
+ *	helpers
+ */
+
+static unit *get_unit(tHandle handle)
+{
+	unit *u = (unit *)handle;
+
+	if (u < units || u >= units + EMU_MAXUNITS || !u->present)
+		return NULL;
+	return u;
+}
+
+static LONG sense(tpSCSICmd cmd, int key, int asc, int ascq)
+{
+	BYTE *s = cmd->SenseBuffer;
+
+	if (s) {
+		memset(s, 0, 18);
+		s[0] = 0x70;
+		s[2] = key;
+		s[7] = 10;
+		s[12] = asc;
+		s[13] = ascq;
+	}
+	return CHECK_CONDITION;
+}
+
+static int formatted(unit *u)
+{
+	int i;
+
+	if (u->blocks == 0)
+		return 0;
+	for (i = 0; i < CYLINDERS * 2; i++)
+		if (!u->fmt[i])
+			return 0;
+	return 1;
+}
+
+static unsigned long seek(unit *u, int cyl)
+{
+	unsigned long us = (unsigned long)abs(cyl - u->head) * emu_time.step;
+
+	u->head = cyl;
+	return us;
+}
+
+static int faulted(unit *u, tpSCSICmd cmd)
+{
+	UBYTE op = (UBYTE)cmd->Cmd[0];
+	unsigned long n = ++u->seen[op];
+	int i;
+	fault *f;
+
+	for (i = 0, f = u->faults; i < u->nfaults; i++, f++) {
+		if (f->opcode != op)
+			continue;
+		if (f->nth == 0 || (n >= f->nth && n < f->nth + f->count)) {
+			sense(cmd, f->key, f->asc, f->ascq);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* put 8 byte capacity descriptor */
+static void capdesc(UBYTE *p, long blocks, int code)
+{
+	p[0] = (blocks >> 24) & 0xff;
+	p[1] = (blocks >> 16) & 0xff;
+	p[2] = (blocks >> 8) & 0xff;
+	p[3] = blocks & 0xff;
+	p[4] = code;
+	p[5] = 0;
+	p[6] = SECTOR >> 8;
+	p[7] = SECTOR & 0xff;
+}
+
+static int busy(unit *u)
+{
+	return clock_us < u->busy_until;
+}
+
+/* format one track side, return modeled time */
+static unsigned long format_track(unit *u, int cyl, int side)
+{
+	unsigned long us = seek(u, cyl);
+
+	memset(u->image + ((long)(cyl * 2 + side) * u->spt) * SECTOR, 0, (long)u->spt * SECTOR);
+	u->fmt[cyl * 2 + side] = 1;
+	return us + emu_time.track;
+}
+
+/*
+ *	commands
+ */
+
+static LONG inquiry(tpSCSICmd cmd)
+{
+	UBYTE data[36];
+
+	memset(data, 0, sizeof(data));
+	data[0] = 0x00;		/* direct access device */
+	data[1] = 0x80;		/* removable */
+	data[3] = 0x01;		/* UFI response data format */
+	data[4] = 31;
+	memcpy(data + 8, "EMULATED", 8);
+	memcpy(data + 16, "USB FLOPPY      ", 16);
+	memcpy(data + 32, "1.00", 4);
+	memcpy(cmd->Buffer, data, cmd->TransferLen < 36 ? cmd->TransferLen : 36);
+	return 0L;
+}
+
+static LONG request_sense(unit *u, tpSCSICmd cmd)
+{
+	UBYTE data[18];
+	unsigned long progress;
+
+	memset(data, 0, sizeof(data));
+	data[0] = 0x70;
+	data[7] = 10;
+	if (busy(u)) {
+		progress = (unsigned long)((clock_us - u->busy_from) * 65536 / (u->busy_until - u->busy_from));
+		data[2] = NOT_READY;
+		data[12] = 0x04;		/* format in progress */
+		data[13] = 0x04;
+		data[15] = 0x80;		/* SKSV */
+		data[16] = (progress >> 8) & 0xff;
+		data[17] = progress & 0xff;
+	}
+	memcpy(cmd->Buffer, data, cmd->TransferLen < 18 ? cmd->TransferLen : 18);
+	return 0L;
+}
+
+static LONG read_format_capacities(unit *u, tpSCSICmd cmd)
+{
+	UBYTE data[252];
+	int n = 1;
+
+	memset(data, 0, sizeof(data));
+	if (u->media == 0)
+		capdesc(data + 4, EMU_HD, 3);
+	else if (formatted(u))
+		capdesc(data + 4, u->blocks, 2);
+	else
+		capdesc(data + 4, u->media, 1);
+	if (u->media == EMU_HD)
+		capdesc(data + 4 + 8 * n++, EMU_HD, 0);
+	if (u->media != 0)
+		capdesc(data + 4 + 8 * n++, EMU_DD, 0);
+	data[3] = 8 * n;
+	memcpy(cmd->Buffer, data, cmd->TransferLen < 252 ? cmd->TransferLen : 252);
+	return 0L;
+}
+
+static LONG format_unit(unit *u, tpSCSICmd cmd, unsigned long *us)
+{
+	UBYTE *cdb = (UBYTE *)cmd->Cmd;
+	UBYTE *parms = cmd->Buffer;
+	long blocks;
+	int cyl, side;
+	unsigned long t = 0;
+
+	if (u->media == 0)
+		return sense(cmd, NOT_READY, 0x3A, 0);
+	if (u->wp)
+		return sense(cmd, DATA_PROTECT, 0x27, 0);
+	if ((cdb[1] & 0x17) != 0x17 || cmd->TransferLen < 12 || cdb[2] >= CYLINDERS)
+		return sense(cmd, ILLEGAL_REQUEST, 0x24, 0);
+	blocks = ((long)parms[4] << 24) | ((long)parms[5] << 16) | ((long)parms[6] << 8) | parms[7];
+	if ((blocks != EMU_HD && blocks != EMU_DD) || parms[10] != (SECTOR >> 8))
+		return sense(cmd, ILLEGAL_REQUEST, 0x26, 0);
+	if (blocks > u->media)
+		return sense(cmd, MEDIUM_ERROR, 0x30, 0);
+
+	if (blocks != u->blocks) {
+		/* new geometry, every track side has to be formatted again */
+		u->blocks = blocks;
+		u->spt = (int)(blocks / (CYLINDERS * 2));
+		memset(u->fmt, 0, sizeof(u->fmt));
+	}
+	if (parms[1] & 0x10) {				/* single track */
+		t = emu_time.index + format_track(u, cdb[2], parms[1] & 0x01);
+	}else {
+		for (cyl = 0; cyl < CYLINDERS; cyl++)
+			for (side = 0; side < 2; side++)
+				t += format_track(u, cyl, side);
+	}
+	if (parms[1] & 0x02) {				/* Immed */
+		u->busy_from = clock_us + *us;
+		u->busy_until = u->busy_from + t;
+	}else {
+		*us += t;
+	}
+	return 0L;
+}
+
+static LONG write10(unit *u, tpSCSICmd cmd, unsigned long *us)
+{
+	UBYTE *cdb = (UBYTE *)cmd->Cmd;
+	long lba, n, i;
+
+	if (u->media == 0)
+		return sense(cmd, NOT_READY, 0x3A, 0);
+	if (u->wp)
+		return sense(cmd, DATA_PROTECT, 0x27, 0);
+	lba = ((long)cdb[2] << 24) | ((long)cdb[3] << 16) | ((long)cdb[4] << 8) | cdb[5];
+	n = (cdb[7] << 8) | cdb[8];
+	if (cmd->TransferLen != (ULONG)n * SECTOR)
+		return sense(cmd, ILLEGAL_REQUEST, 0x24, 0);
+	if (u->blocks == 0 || lba + n > u->blocks)
+		return sense(cmd, ILLEGAL_REQUEST, 0x21, 0);
+	*us += emu_time.latency;
+	for (i = lba; i < lba + n; i++) {
+		if (!u->fmt[i / u->spt])
+			return sense(cmd, MEDIUM_ERROR, 0x31, 0);
+		*us += seek(u, (int)(i / (u->spt * 2))) + emu_time.rev / u->spt;
+	}
+	memcpy(u->image + lba * SECTOR, cmd->Buffer, n * SECTOR);
+	return 0L;
+}
+
+static LONG read10(unit *u, tpSCSICmd cmd, unsigned long *us)
+{
+	UBYTE *cdb = (UBYTE *)cmd->Cmd;
+	long lba, n, i;
+
+	if (u->media == 0)
+		return sense(cmd, NOT_READY, 0x3A, 0);
+	lba = ((long)cdb[2] << 24) | ((long)cdb[3] << 16) | ((long)cdb[4] << 8) | cdb[5];
+	n = (cdb[7] << 8) | cdb[8];
+	if (cmd->TransferLen != (ULONG)n * SECTOR)
+		return sense(cmd, ILLEGAL_REQUEST, 0x24, 0);
+	if (u->blocks == 0 || lba + n > u->blocks)
+		return sense(cmd, ILLEGAL_REQUEST, 0x21, 0);
+	*us += emu_time.latency;
+	for (i = lba; i < lba + n; i++) {
+		if (!u->fmt[i / u->spt])
+			return sense(cmd, MEDIUM_ERROR, 0x31, 0);
+		*us += seek(u, (int)(i / (u->spt * 2))) + emu_time.rev / u->spt;
+		if (u->bad[i >> 3] & (1 << (i & 7))) {
+			*us += 3 * emu_time.rev;		/* retries */
+			return sense(cmd, MEDIUM_ERROR, 0x11, 0);
+		}
+	}
+	memcpy(cmd->Buffer, u->image + lba * SECTOR, n * SECTOR);
+	return 0L;
+}
+
+static LONG mode_sense10(unit *u, tpSCSICmd cmd)
+{
+	UBYTE data[8];
+
+	memset(data, 0, sizeof(data));
+	data[1] = 6;
+	data[2] = (u->media == 0) ? 0x70 : (u->blocks == EMU_DD) ? 0x1E : 0x94;
+	data[3] = u->wp ? 0x80 : 0x00;
+	memcpy(cmd->Buffer, data, cmd->TransferLen < 8 ? cmd->TransferLen : 8);
+	return 0L;
+}
+
+static LONG cdecl emu_command(tpSCSICmd cmd)
+{
+	unit *u = get_unit(cmd->Handle);
+	UBYTE op;
+	unsigned long us;
+	LONG rc;
+
+	if (u == NULL)
+		return SELECTERROR;
+	op = (UBYTE)cmd->Cmd[0];
+	us = emu_time.overhead;
+
+	if (faulted(u, cmd))
+		rc = CHECK_CONDITION;
+	else if (u->attention && op != 0x03 && op != 0x12) {
+		u->attention = 0;
+		rc = sense(cmd, UNIT_ATTENTION, 0x28, 0);
+	}else if (busy(u) && op != 0x03 && op != 0x12)
+		rc = sense(cmd, NOT_READY, 0x04, 0x04);
+	else switch (op) {
+		case 0x00 :
+			rc = (u->media == 0) ? sense(cmd, NOT_READY, 0x3A, 0) : 0L;
+			break;
+		case 0x03 :
+			rc = request_sense(u, cmd);
+			break;
+		case 0x12 :
+			rc = inquiry(cmd);
+			break;
+		case 0x23 :
+			rc = read_format_capacities(u, cmd);
+			break;
+		case 0x04 :
+			rc = format_unit(u, cmd, &us);
+			break;
+		case 0x28 :
+			rc = read10(u, cmd, &us);
+			break;
+		case 0x2A :
+			rc = write10(u, cmd, &us);
+			break;
+		case 0x5A :
+			rc = mode_sense10(u, cmd);
+			break;
+		default :
+			rc = sense(cmd, ILLEGAL_REQUEST, 0x20, 0);
+			break;
+	}
+	if (rc == 0L) {
+		us += cmd->TransferLen * emu_time.xfer / 1000L;
+		emu_stat.bytes += cmd->TransferLen;
+	}
+
+	clock_us += us;
+	emu_stat.commands++;
+	emu_stat.time += us;
+	emu_stat.count[op]++;
+	emu_stat.optime[op] += us;
+
+	if (us > cmd->Timeout * 5000UL)		/* Timeout is in 1/200 s */
+		return TIMEOUTERROR;
+	return rc;
+}
+
+/*
+ *	bus and device management
+ */
+
+static LONG cdecl emu_inquire_scsi(WORD what, tBusInfo *info)
+{
+	if (what == cInqFirst)
+		inqbus = 0;
+	if (inqbus >= emu_busses)
+		return -1L;
+	memset(info, 0, sizeof(tBusInfo));
+	strcpy(info->BusName, (inqbus == 0) ? "USB Mass Storage" : "USB Mass Storage 2");
+	info->BusNo = EMU_BUSNO + inqbus++;
+	info->Features = cAllCmds;
+	info->MaxLen = emu_maxlen;
+	return 0L;
+}
+
+static LONG cdecl emu_inquire_bus(WORD what, WORD BusNo, tDevInfo *Dev)
+{
+	if (BusNo < EMU_BUSNO || BusNo >= EMU_BUSNO + emu_busses)
+		return -1L;
+	if (what == cInqFirst)
+		inqdev = 0;
+	while (inqdev < EMU_MAXUNITS && (!units[inqdev].present || UNIT_BUS(inqdev) != BusNo))
+		inqdev++;
+	if (inqdev == EMU_MAXUNITS)
+		return -1L;
+	memset(Dev, 0, sizeof(tDevInfo));
+	Dev->SCSIId.hi = 0;
+	Dev->SCSIId.lo = inqdev++;
+	return 0L;
+}
+
+static LONG cdecl emu_check_dev(WORD BusNo, const DLONG *SCSIId, char *Name, UWORD *Features)
+{
+	if (SCSIId->lo >= EMU_MAXUNITS || BusNo != UNIT_BUS(SCSIId->lo) || !units[SCSIId->lo].present)
+		return -1L;
+	if (Name)
+		strcpy(Name, "USB Mass Storage");
+	if (Features)
+		*Features = cAllCmds;
+	return 0L;
+}
+
+static LONG cdecl emu_rescan_bus(WORD BusNo)
+{
+	return (BusNo >= EMU_BUSNO && BusNo < EMU_BUSNO + emu_busses) ? 0L : -1L;
+}
+
+static LONG cdecl emu_open(WORD BusNo, const DLONG *SCSIId, ULONG *MaxLen)
+{
+	unit *u;
+
+	if (SCSIId->lo >= EMU_MAXUNITS || BusNo != UNIT_BUS(SCSIId->lo))
+		return -1L;
+	u = &units[SCSIId->lo];
+	if (!u->present)
+		return -1L;
+	if (MaxLen)
+		*MaxLen = emu_maxlen;
+	u->features = cAllCmds;
+	return (LONG)u;
+}
+
+static LONG cdecl emu_close(tHandle handle)
+{
+	return get_unit(handle) ? 0L : -1L;
+}
+
+static LONG cdecl emu_error(tHandle handle, WORD rwflag, WORD ErrNo)
+{
+	unit *u = get_unit(handle);
+	int old;
+
+	if (u == NULL)
+		return -1L;
+	old = u->errs;
+	if (rwflag == cErrWrite)
+		u->errs |= 1 << ErrNo;
+	else
+		u->errs &= ~(1 << ErrNo);
+	return old & (1 << ErrNo);
+}
+
+/*
+ *	public
+ */
+
+/* unit behind a handle returned by Open(), -1 if none */
+int emu_unit(tHandle handle)
+{
+	unit *u = get_unit(handle);
+
+	return u ? (int)(u - units) : -1;
+}
+
+tpScsiCall emu_init(void)
+{
+	memset(&table, 0, sizeof(table));
+	table.Version = SCSIRevision;
+	table.In = emu_command;
+	table.Out = emu_command;
+	table.InquireSCSI = emu_inquire_scsi;
+	table.InquireBus = emu_inquire_bus;
+	table.CheckDev = emu_check_dev;
+	table.RescanBus = emu_rescan_bus;
+	table.Open = emu_open;
+	table.Close = emu_close;
+	table.Error = emu_error;
+	setcookie(0x53435349L, (long)&table);		/* 'SCSI' */
+	return &table;
+}
+
+/* attach drive and insert a blank or formatted medium (media 0: empty drive) */
+int emu_insert(int n, long media, int formatted, int wp)
+{
+	unit *u;
+
+	if (n < 0 || n >= EMU_MAXUNITS || (media != 0 && media != EMU_HD && media != EMU_DD))
+		return -1;
+	u = &units[n];
+	free(u->image);
+	u->image = NULL;
+	u->present = 1;
+	u->media = media;
+	u->blocks = 0;
+	u->spt = 0;
+	u->wp = wp;
+	u->head = 0;
+	u->attention = (media != 0);
+	u->busy_from = u->busy_until = 0;
+	memset(u->bad, 0, sizeof(u->bad));
+	memset(u->fmt, 0, sizeof(u->fmt));
+	if (media) {
+		u->image = calloc(media, SECTOR);
+		if (u->image == NULL)
+			return -1;
+		if (formatted) {
+			u->blocks = media;
+			u->spt = (int)(media / (CYLINDERS * 2));
+			memset(u->fmt, 1, sizeof(u->fmt));
+		}
+	}
+	u->errs |= 1 << cErrMediach;
+	return 0;
+}
+
+int emu_eject(int n)
+{
+	return emu_insert(n, 0L, 0, 0);
+}
+
+int emu_load(int n, const char *path, int wp)
+{
+	FILE *f;
+	long size;
+	int rc = -1;
+
+	f = fopen(path, "rb");
+	if (f == NULL)
+		return -1;
+	fseek(f, 0L, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	if ((size == EMU_HD * SECTOR || size == EMU_DD * SECTOR) && emu_insert(n, size / SECTOR, 1, wp) == 0)
+		rc = (fread(units[n].image, SECTOR, size / SECTOR, f) == (size_t)(size / SECTOR)) ? 0 : -1;
+	fclose(f);
+	return rc;
+}
+
+int emu_save(int n, const char *path)
+{
+	FILE *f;
+	int rc;
+
+	if (emu_image(n) == NULL || units[n].blocks == 0)
+		return -1;
+	f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+	rc = (fwrite(units[n].image, SECTOR, units[n].blocks, f) == (size_t)units[n].blocks) ? 0 : -1;
+	fclose(f);
+	return rc;
+}
+
+int emu_bad(int n, long lba)
+{
+	if (n < 0 || n >= EMU_MAXUNITS || lba < 0 || lba >= EMU_HD)
+		return -1;
+	units[n].bad[lba >> 3] |= 1 << (lba & 7);
+	return 0;
+}
+
+int emu_fault(int n, int opcode, unsigned long nth, unsigned long count, int key, int asc, int ascq)
+{
+	unit *u;
+	fault *f;
+
+	if (n < 0 || n >= EMU_MAXUNITS || units[n].nfaults == EMU_MAXFAULTS)
+		return -1;
+	u = &units[n];
+	f = &u->faults[u->nfaults++];
+	f->opcode = opcode;
+	f->nth = nth;
+	f->count = count ? count : 1;
+	f->key = key;
+	f->asc = asc;
+	f->ascq = ascq;
+	return 0;
+}
+
+unsigned char *emu_image(int n)
+{
+	return (n >= 0 && n < EMU_MAXUNITS) ? units[n].image : NULL;
+}
+
+long emu_blocks(int n)
+{
+	return (n >= 0 && n < EMU_MAXUNITS) ? units[n].blocks : 0L;
+}
+
+void emu_advance(unsigned long us)
+{
+	clock_us += us;
+}
+
+unsigned long long emu_clock(void)
+{
+	return clock_us;
+}
+
+void emu_reset_stats(void)
+{
+	memset(&emu_stat, 0, sizeof(emu_stat));
+}
+
+const char *emu_opname(int opcode)
+{
+	switch (opcode) {
+		case 0x00 : return "TEST UNIT READY";
+		case 0x03 : return "REQUEST SENSE";
+		case 0x04 : return "FORMAT UNIT";
+		case 0x12 : return "INQUIRY";
+		case 0x23 : return "READ FORMAT CAPACITIES";
+		case 0x28 : return "READ(10)";
+		case 0x2A : return "WRITE(10)";
+		case 0x5A : return "MODE SENSE(10)";
+		default : return "?";
+	}
+}
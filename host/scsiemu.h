@@ -0,0 +1,57 @@
+/*
+ * uFormat host SCSIDRV emulator
+ *
+ * A 'SCSI' cookie table backed by in-memory floppy images, so that the
+ * routines in FORMAT.C can be run and measured on a Linux host.
+ */
+
+#ifndef __SCSIEMU_H
+#define __SCSIEMU_H
+
+#include "scsidefs.h"
+
+#define EMU_MAXUNITS	4
+#define EMU_MAXFAULTS	8
+#define EMU_HD			2880L		/* blocks on a 1.44MB medium */
+#define EMU_DD			1440L		/* blocks on a 720K medium */
+
+/* modeled cost of a command, all values configurable */
+typedef struct {
+	unsigned long overhead;	/* us, USB command/status round trip */
+	unsigned long xfer;		/* ns per byte moved over USB */
+	unsigned long rev;		/* us per revolution, a sector takes rev / spt */
+	unsigned long step;		/* us per cylinder stepped */
+	unsigned long track;	/* us to format one track side */
+	unsigned long index;	/* us waiting for the index hole before a single track format */
+	unsigned long latency;	/* us of rotational latency before a READ(10)/WRITE(10) */
+}emu_timing;
+
+typedef struct {
+	unsigned long commands;
+	unsigned long bytes;				/* data phase bytes, both directions */
+	unsigned long long time;			/* us spent in commands */
+	unsigned long count[256];			/* per opcode */
+	unsigned long long optime[256];
+}emu_stats;
+
+extern emu_timing emu_time;
+extern emu_stats emu_stat;
+extern ULONG emu_maxlen;				/* MaxLen returned by Open() */
+extern int emu_busses;					/* unit n is on bus 2 + n % emu_busses */
+
+tpScsiCall emu_init(void);
+int emu_unit(tHandle handle);
+int emu_insert(int unit, long media, int formatted, int wp);
+int emu_eject(int unit);
+int emu_load(int unit, const char *path, int wp);
+int emu_save(int unit, const char *path);
+int emu_bad(int unit, long lba);
+int emu_fault(int unit, int opcode, unsigned long nth, unsigned long count, int key, int asc, int ascq);
+unsigned char *emu_image(int unit);
+long emu_blocks(int unit);
+void emu_advance(unsigned long us);
+unsigned long long emu_clock(void);
+void emu_reset_stats(void);
+const char *emu_opname(int opcode);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * uFormat host stand-ins for the TOS, cookie, ext and time library
+ * calls used by FORMAT.C
+ *
+ * Distributed under the MIT license, see LICENSE.
+ */
+
+#include <string.h>
+#include "tosemu.h"
+#include "scsiemu.h"
+
+#define MAXCOOKIES	8
+
+static struct {
+	long id;
+	long value;
+} jar[MAXCOOKIES];
+static int ncookies;
+
+/* Protobt() prototypes for disk types 0 to 4, as in TOS */
+static const struct {
+	int spc, ndirs, nsects, media, spf, spt, nsides;
+} proto[] = {
+	{ 1,  64,  360, 0xFC, 2,  9, 1 },	/* 0: 40 tracks, single sided */
+	{ 2, 112,  720, 0xFD, 2,  9, 2 },	/* 1: 40 tracks, double sided */
+	{ 2, 112,  720, 0xF8, 5,  9, 1 },	/* 2: 80 tracks, single sided */
+	{ 2, 112, 1440, 0xF9, 5,  9, 2 },	/* 3: 80 tracks, double sided */
+	{ 2, 224, 2880, 0xF0, 5, 18, 2 }	/* 4: 80 tracks, high density */
+};
+
+static unsigned long seed = 0x12345678L;	/* fixed, keeps runs repeatable */
+
+void *Super(void *stack)
+{
+	(void)stack;
+	return NULL;
+}
+
+static void putw_le(unsigned char *p, int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+void Protobt(void *buf, long serialno, int disktype, int execflag)
+{
+	unsigned char *b = buf;
+	unsigned int sum;
+	int i;
+
+	if (serialno >= 0x01000000L) {
+		seed = seed * 1103515245L + 12345L;
+		serialno = (seed >> 8) & 0xffffffL;
+	}
+	if (serialno >= 0) {
+		b[8] = serialno & 0xff;
+		b[9] = (serialno >> 8) & 0xff;
+		b[10] = (serialno >> 16) & 0xff;
+	}
+	if (disktype >= 0 && disktype <= 4) {
+		putw_le(b + 11, 512);
+		b[13] = proto[disktype].spc;
+		putw_le(b + 14, 1);
+		b[16] = 2;
+		putw_le(b + 17, proto[disktype].ndirs);
+		putw_le(b + 19, proto[disktype].nsects);
+		b[21] = proto[disktype].media;
+		putw_le(b + 22, proto[disktype].spf);
+		putw_le(b + 24, proto[disktype].spt);
+		putw_le(b + 26, proto[disktype].nsides);
+		putw_le(b + 28, 0);
+	}
+
+	/* big endian word checksum, 0x1234 means executable */
+	for (sum = 0, i = 0; i < 510; i += 2)
+		sum += (b[i] << 8) | b[i + 1];
+	sum &= 0xffff;
+	if (execflag == 1) {
+		sum = (0x1234 - sum) & 0xffff;
+		b[510] = sum >> 8;
+		b[511] = sum & 0xff;
+	}else if (execflag == 0 && ((sum + ((b[510] << 8) | b[511])) & 0xffff) == 0x1234) {
+		b[511]++;
+	}
+}
+
+int getcookie(long cookie, long *value)
+{
+	int i;
+
+	for (i = 0; i < ncookies; i++) {
+		if (jar[i].id == cookie) {
+			if (value)
+				*value = jar[i].value;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int setcookie(long cookie, long value)
+{
+	int i;
+
+	for (i = 0; i < ncookies; i++) {
+		if (jar[i].id == cookie) {
+			jar[i].value = value;
+			return 1;
+		}
+	}
+	if (ncookies == MAXCOOKIES)
+		return 0;
+	jar[ncookies].id = cookie;
+	jar[ncookies].value = value;
+	ncookies++;
+	return 1;
+}
+
+void delay(unsigned long ms)
+{
+	/* waiting only costs modeled time */
+	emu_advance(ms * 1000UL);
+}
+
+long emu_hz200(void)
+{
+	return (long)(emu_clock() / 5000ULL);
+}
@@ -0,0 +1,19 @@
+/*
+ * uFormat host stand-ins for the TOS, cookie, ext and time library
+ * calls used by FORMAT.C
+ */
+
+#ifndef __TOSEMU_H
+#define __TOSEMU_H
+
+void *Super(void *stack);
+void Protobt(void *buf, long serialno, int disktype, int execflag);
+int getcookie(long cookie, long *value);
+int setcookie(long cookie, long value);
+void delay(unsigned long ms);
+long emu_hz200(void);
+
+/* Pure C's clock() counts the 200 Hz system timer, here it follows the modeled clock */
+#define clock()	emu_hz200()
+
+#endif